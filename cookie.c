@@ -0,0 +1,77 @@
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+
+#include "cookie.h"
+
+/* The key for SipHash, picked at random when the server starts */
+static uint64_t key[2];
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND \
+    do { \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+    } while (0)
+
+/* SipHash-2-4 of two 64 bit words. It is fast on short input and can not be
+ * forged without the key, which is what a cookie needs. */
+static uint64_t siphash( uint64_t m0, uint64_t m1 )
+{
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL;
+    uint64_t v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL;
+    uint64_t v3 = key[1] ^ 0x7465646279746573ULL;
+    uint64_t last = (uint64_t) 16 << 56;
+
+    v3 ^= m0; SIPROUND; SIPROUND; v0 ^= m0;
+    v3 ^= m1; SIPROUND; SIPROUND; v0 ^= m1;
+    v3 ^= last; SIPROUND; SIPROUND; v0 ^= last;
+
+    v2 ^= 0xff;
+    SIPROUND; SIPROUND; SIPROUND; SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* The cookie for one period. The address, port and senderid go in the first
+ * word, and the period in the second. */
+static uint32_t cookie_for( struct sockaddr_in client, int senderid, uint64_t period )
+{
+    uint64_t m0 = ((uint64_t) client.sin_addr.s_addr << 32) | (uint32_t) senderid;
+    uint64_t m1 = (period << 16) | client.sin_port;
+    uint32_t cookie = (uint32_t) siphash( m0, m1 );
+
+    if( cookie == 0 )
+    {
+        cookie = 1;
+    }
+    return cookie;
+}
+
+int cookie_init( void )
+{
+    if( getrandom( key, sizeof(key), 0 ) != sizeof(key) )
+    {
+        return -1;
+    }
+    return 0;
+}
+
+uint32_t cookie_make( struct sockaddr_in client, int senderid )
+{
+    return cookie_for( client, senderid, time(NULL) / COOKIE_LIFETIME );
+}
+
+int cookie_check( struct sockaddr_in client, int senderid, uint32_t cookie )
+{
+    uint64_t period = time(NULL) / COOKIE_LIFETIME;
+
+    return cookie != 0 &&
+           (cookie == cookie_for( client, senderid, period ) ||
+            cookie == cookie_for( client, senderid, period - 1 ));
+}
@@ -0,0 +1,30 @@
+#ifndef COOKIE_H
+#define COOKIE_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* How many seconds a cookie is valid for. A cookie made in the previous
+ * period is still accepted, so a client always has at least this long to
+ * echo it.
+ */
+#define COOKIE_LIFETIME 10
+
+/* Picks the random key the cookies are made with. Call it once at the start
+ * of the program. Returns -1 if no random key could be read.
+ */
+int cookie_init( void );
+
+/* Makes the cookie for a connect request from the client address and the
+ * senderid of the request. The cookie is a keyed hash, so a client can not
+ * make one without asking the server, and it is never 0, which means that a
+ * request has no cookie.
+ */
+uint32_t cookie_make( struct sockaddr_in client, int senderid );
+
+/* Returns 1 if the cookie is the one cookie_make gives for this client and
+ * senderid, now or in the previous period, and 0 if it is not.
+ */
+int cookie_check( struct sockaddr_in client, int senderid, uint32_t cookie );
+
+#endif /* COOKIE_H */
@@ -0,0 +1,28 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "fec.h"
+
+/* fec_xor works on 8 bytes at a time instead of one. Each group has a single
+ * XOR parity packet, so only one lost packet per group can be rebuilt. If two
+ * or more packets of a group are lost, the client waits for them to be sent
+ * again. */
+void fec_xor( char* dst, const char* src, size_t len )
+{
+    size_t i = 0;
+    uint64_t a;
+    uint64_t b;
+
+    for( ; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t) )
+    {
+        memcpy( &a, dst + i, sizeof(uint64_t) );
+        memcpy( &b, src + i, sizeof(uint64_t) );
+        a ^= b;
+        memcpy( dst + i, &a, sizeof(uint64_t) );
+    }
+
+    for( ; i < len; i++ )
+    {
+        dst[i] ^= src[i];
+    }
+}
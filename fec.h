@@ -0,0 +1,20 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <stddef.h>
+
+/* The number of data packets a parity packet is made over. The server starts
+ * at the group size it is given, and moves between these limits depending on
+ * how much loss the client reports.
+ */
+#define FEC_K_MIN 2
+#define FEC_K_MAX 16
+
+/* XORs len bytes of src into dst. This is used both to make a parity packet
+ * from the data packets of a group, and to rebuild a lost data packet from the
+ * parity packet and the rest of the group. With one parity packet per group,
+ * at most one lost packet per group can be rebuilt.
+ */
+void fec_xor( char* dst, const char* src, size_t len );
+
+#endif /* FEC_H */
@@ -7,8 +7,11 @@
 #define CONN_TERM 0x02
 #define CONN_ACCP 0x10
 #define CONN_DENY 0x20
+#define CONN_QUEUED 0x40
+#define CONN_CHAL 0x80 //answer to a connect request without a cookie, metadata is the cookie
 #define PKT 0x04
 #define ACK 0x08
+#define PAR 0x84 //parity packet, has the PKT bit so it is dropped like data packets
 
 struct header {
     unsigned char flags;
@@ -21,7 +24,7 @@ struct header {
 };
 
 
-struct header* createHeader(unsigned char flags, unsigned char pktseq, unsigned char ackseq, int senderid, int recvid, int metadata) {
+static struct header* createHeader(unsigned char flags, unsigned char pktseq, unsigned char ackseq, int senderid, int recvid, int metadata) {
     struct header* h = malloc(sizeof(struct header));
     h->flags = flags;
     h->pktseq = pktseq;
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "send_packet.h"
+#include "rdp_client.h"
+
+
+/*Struct for the results of the downloads
+done: the number of downloads that have ended
+failed: the number of downloads that did not end with RDP_STATUS_OK*/
+struct results {
+    int done;
+    int failed;
+};
+
+
+/*Function that is called when a download has ended, and counts it
+transfer: the transfer that ended
+status: the RDP_STATUS_ value it ended with
+data: the results to count it in*/
+void download_done(struct rdp_transfer* transfer, int status, void* data) {
+    struct results* results = (struct results*) data;
+    results->done++;
+    if (status != RDP_STATUS_OK) {
+        results->failed++;
+        printf("FILE %s: download failed with status %d\n", transfer->filename, status);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+
+    if(argc < 5) {
+        printf("4 arguments needed: <IPv4 address / hostname of server> <UDP port of server> <loss probability> <N number of files to fetch>\n");
+        return 1;
+    }
+
+
+    /*Set arguments*/
+    unsigned char* address = argv[1];
+    unsigned int port = atoi(argv[2]);
+    float prob = atof(argv[3]);
+    int files = atoi(argv[4]);
+    srand(time(0));
+    set_loss_probability(prob);
+
+    if (prob < 0 || prob > 1 || port == 0 || files < 1 || files > 10000) {
+        printf("ERROR: The port must be a digit,\n");
+        printf(" the loss probability must be between 0 and 1,\n");
+        printf(" and the number of files must be between 1 and 10000\n");
+        return 2;
+    }
+
+
+    /*Create one socket that all downloads share*/
+    struct rdp_client* client = rdp_client_create(address, port);
+    if (client == NULL) {
+        printf("ERROR: Socket is invalid\n");
+        return 3;
+    }
+
+
+    /*Start every download at once, and let the event loop drive them until all have ended*/
+    struct results results;
+    memset(&results, 0, sizeof(struct results));
+    int i;
+    for (i = 0; i < files; i++) {
+        rdp_transfer_create(client, rdp_client_free_id(client), download_done, &results);
+    }
+    rdp_client_run(client);
+    rdp_client_destroy(client);
+
+    printf("\n%d of %d downloads complete\n\n", results.done - results.failed, files);
+    if (results.failed > 0) {
+        return 4;
+    }
+    return 0;
+}
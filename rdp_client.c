@@ -0,0 +1,770 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "rdp_client.h"
+
+
+/*Help method that returns the time in milliseconds, used for the timers of the transfers*/
+static long now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+
+/*Function that sends a termination packet to the server when it receives an empty data packet
+socket: the client socket to send packet from
+senderid: the ID of the client, set as senderid
+server: the server address*/
+static void terminate_connection(int socket, int senderid, struct sockaddr_in server) {
+    char* packet = (char *) createHeader(CONN_TERM, 0, 0, htonl(senderid), htonl(0), 0);
+    int send = send_packet(socket, packet, sizeof(struct header), 0, (struct sockaddr*)&server, sizeof(server));
+    free(packet);
+}
+
+
+/*Help method that makes the name of the file a transfer writes to*/
+static char* get_filename(int clientid) {
+    /*"kernel-file-" is 12 characters, and an int takes at most 11 with its sign*/
+    char* filename = malloc(sizeof(char) * 24);
+    snprintf(filename, 24, "kernel-file-%i", clientid);
+    return filename;
+}
+
+
+/*Help method that checks the payload size a data packet claims, which comes from the network.
+Return 1 if it is between 1 and PAYLOAD_MAX_SIZE and the datagram of len bytes holds that much payload*/
+static int payload_fits(struct header* header, int len) {
+    return header->metadata > 0 && header->metadata <= PAYLOAD_MAX_SIZE
+        && header->metadata <= len - (int) sizeof(struct header);
+}
+
+
+/*Function that hands the payload to the writer thread if the packet sequence has the correct ack
+Every packet before the last has a full payload, so the payload goes at ack full payloads into the file
+Return 0 if the packet is not next in line, or the writer has no free buffer for it
+writer: the writer thread
+transfer: the transfer with the file we want to write to
+packet: the packet containing the payload
+ack: the ack number in the sequence we are currently at*/
+static int rdp_write(struct rdp_writer* writer, struct rdp_transfer* transfer, char* packet, int ack) {
+    struct header* header = (struct header*) packet;
+    char* payload = (packet + sizeof(struct header));
+    if (header->pktseq == (ack + 1)) {
+        off_t offset = (off_t) ack * PAYLOAD_MAX_SIZE;
+        if (rdp_writer_write(writer, transfer, transfer->fd, offset, payload, header->metadata) == 0) {
+            return 0;
+        }
+        printf("Writing to file with payload from pkt nr: %d\n", header->pktseq);
+        return 1;
+    }
+    return 0;
+}
+
+
+/*Function that frees the packets of a FEC group and makes it ready for a new group
+group: the group to reset
+start and end: the first and last packet of the new group*/
+static void fec_reset(struct fec_group* group, int start, int end) {
+    int i;
+    for (i = 0; i < FEC_K_MAX; i++) {
+        free(group->packets[i]);
+        group->packets[i] = NULL;
+    }
+    free(group->parity);
+    group->parity = NULL;
+    group->start = start;
+    group->end = end;
+    group->recovered = 0;
+}
+
+
+/*Function that adds a data or parity packet to the FEC group
+Data packets carry the last packet of the group as ackseq and the size of the group as unassigned,
+parity packets carry the first and last packet of the group as pktseq and ackseq
+A group that starts right after the ack replaces the old group
+Packets that are already written or belong to another group are freed,
+and so are packets whose size from the network does not fit, as it is used as the XOR length
+group: the group to add the packet to
+packet: the packet, which is owned by the group after this
+len: the number of bytes in the packet
+ack: the ack the client is at*/
+static void fec_add(struct fec_group* group, char* packet, int len, int ack) {
+    struct header* header = (struct header*) packet;
+    /*The metadata of a parity packet is the XOR of the sizes, so only its sign can be checked here*/
+    if ((header->flags == PAR && (header->metadata < 0 || len <= (int) sizeof(struct header)))
+        || (header->flags != PAR && payload_fits(header, len) == 0)) {
+        free(packet);
+        return;
+    }
+    int end = header->ackseq;
+    int start = end - header->unassigned + 1;
+    if (header->flags == PAR) {
+        start = header->pktseq;
+    }
+
+    if (start != group->start && start == ack + 1 && end - start < FEC_K_MAX) {
+        fec_reset(group, start, end);
+    }
+    if (start != group->start || end != group->end) {
+        free(packet);
+        return;
+    }
+
+    if (header->flags == PAR) {
+        if (group->parity == NULL) {
+            group->parity = packet;
+            return;
+        }
+    }
+    else if (header->pktseq > ack && header->pktseq <= end && group->packets[header->pktseq - start] == NULL) {
+        group->packets[header->pktseq - start] = packet;
+        return;
+    }
+    free(packet);
+}
+
+
+/*Function that rebuilds a lost packet in the FEC group,
+if the parity packet and all the other packets of the group have arrived
+The payload is the XOR of the parity and the other payloads,
+and the size is the XOR of the parity metadata and the other sizes
+group: the group to rebuild a packet in*/
+static void fec_recover(struct fec_group* group) {
+    if (group->parity == NULL) {
+        return;
+    }
+    int missing = -1;
+    int i;
+    for (i = 0; i <= group->end - group->start; i++) {
+        if (group->packets[i] == NULL) {
+            if (missing != -1) {
+                return;
+            }
+            missing = i;
+        }
+    }
+    if (missing == -1) {
+        return;
+    }
+
+    char* packet = malloc(PACKET_MAX_SIZE);
+    memcpy(packet, group->parity, PACKET_MAX_SIZE);
+    struct header* header = (struct header*) packet;
+    for (i = 0; i <= group->end - group->start; i++) {
+        if (i != missing) {
+            struct header* other = (struct header*) group->packets[i];
+            fec_xor(packet + sizeof(struct header), group->packets[i] + sizeof(struct header), other->metadata);
+            header->metadata ^= other->metadata;
+        }
+    }
+    /*The rebuilt size is made from sizes from the network, so a parity packet that does not match
+    the group is thrown away, and the lost packet waits to be sent again*/
+    if (header->metadata < 1 || header->metadata > PAYLOAD_MAX_SIZE) {
+        free(packet);
+        free(group->parity);
+        group->parity = NULL;
+        return;
+    }
+    header->flags = PKT;
+    header->pktseq = group->start + missing;
+    group->packets[missing] = packet;
+    group->recovered++;
+    printf("Rebuilt pkt nr: %d from parity\n", header->pktseq);
+}
+
+
+/*Function that writes the packets of the FEC group that are next in line to file
+The packets are kept until the group is done, as they are needed to rebuild a lost packet
+writer: the writer thread
+transfer: the transfer with the file we want to write to, and the group to write from
+ack: the ack the client is at
+Return the new ack*/
+static int fec_write(struct rdp_writer* writer, struct rdp_transfer* transfer, int ack) {
+    struct fec_group* group = &transfer->group;
+    while (ack >= group->start - 1 && ack < group->end && group->packets[ack + 1 - group->start] != NULL) {
+        if (rdp_write(writer, transfer, group->packets[ack + 1 - group->start], ack) == 0) {
+            break;
+        }
+        ack++;
+    }
+    return ack;
+}
+
+
+/*Function to create an ack packet and send it
+socket: the client socket to send packet from
+senderid: the ID of the client, set as senderid
+server: the server address
+ack: the packet it is acking for
+recovered: the number of packets rebuilt from parity, so the server can adjust the FEC group size
+window: the number of packets the client has room for, so the server does not send more than that*/
+static void send_ack(int socket, int senderid, struct sockaddr_in server, int ack, int recovered, int window) {
+    char* packet = (char *) createHeader(ACK, 0, ack, htonl(senderid), htonl(0), window);
+    ((struct header*) packet)->unassigned = recovered;
+    int send = send_packet(socket, packet, sizeof(struct header), 0, (struct sockaddr*)&server, sizeof(server));
+    free(packet);
+}
+
+
+/*Function that finds a running transfer from its ID, NULL if there is none
+client: the client the transfer runs in
+id: the ID of the transfer*/
+static struct rdp_transfer* find_transfer(struct rdp_client* client, int id) {
+    struct rdp_transfer* transfer = client->transfers[(unsigned int) id % RDP_BUCKETS];
+    while (transfer != NULL && transfer->id != id) {
+        transfer = transfer->next;
+    }
+    return transfer;
+}
+
+
+/*Function that returns the window to advertise in acks,
+which is the free pool buffers shared between the transfers that are receiving
+The share is rounded up, so every transfer may send while there is any free buffer
+When the disk is slow the pool runs empty, and the server stops sending until it has been written
+client: the client the transfers run in*/
+static int receive_window(struct rdp_client* client) {
+    if (client->receiving <= 1) {
+        return client->writer.free_count;
+    }
+    return (client->writer.free_count + client->receiving - 1) / client->receiving;
+}
+
+
+/*Help methods that keep the timer heap in order after the deadline of the transfer at index has changed,
+by moving it up towards the earliest deadline or down away from it*/
+static void timer_place(struct rdp_client* client, int index, struct rdp_transfer* transfer) {
+    client->timers[index] = transfer;
+    transfer->timer = index;
+}
+
+static void timer_up(struct rdp_client* client, int index) {
+    struct rdp_transfer* transfer = client->timers[index];
+    while (index > 0 && client->timers[(index - 1) / 2]->deadline > transfer->deadline) {
+        timer_place(client, index, client->timers[(index - 1) / 2]);
+        index = (index - 1) / 2;
+    }
+    timer_place(client, index, transfer);
+}
+
+static void timer_down(struct rdp_client* client, int index) {
+    struct rdp_transfer* transfer = client->timers[index];
+    while (2 * index + 1 < client->timer_count) {
+        int child = 2 * index + 1;
+        if (child + 1 < client->timer_count && client->timers[child + 1]->deadline < client->timers[child]->deadline) {
+            child++;
+        }
+        if (client->timers[child]->deadline >= transfer->deadline) {
+            break;
+        }
+        timer_place(client, index, client->timers[child]);
+        index = child;
+    }
+    timer_place(client, index, transfer);
+}
+
+
+/*Function that stops the timer of a transfer, and takes it out of the timer heap
+client: the client the transfer runs in
+transfer: the transfer to stop the timer for*/
+static void stop_timer(struct rdp_client* client, struct rdp_transfer* transfer) {
+    transfer->deadline = LONG_MAX;
+    if (transfer->timer == -1) {
+        return;
+    }
+    int index = transfer->timer;
+    transfer->timer = -1;
+    client->timer_count--;
+    if (index == client->timer_count) {
+        return;
+    }
+    /*Fill the hole with the last transfer in the heap, and move it to where it belongs*/
+    struct rdp_transfer* last = client->timers[client->timer_count];
+    timer_place(client, index, last);
+    timer_up(client, index);
+    timer_down(client, last->timer);
+}
+
+
+/*Function that restarts the timer of a transfer
+client: the client the transfer runs in
+transfer: the transfer to set the timer for
+ms: milliseconds until the timer runs out, or -1 to stop the timer*/
+static void set_timer(struct rdp_client* client, struct rdp_transfer* transfer, int ms) {
+    if (ms < 0) {
+        stop_timer(client, transfer);
+        return;
+    }
+    transfer->deadline = now_ms() + ms;
+    if (transfer->timer == -1) {
+        if (client->timer_count == client->timer_room) {
+            client->timer_room = client->timer_room == 0 ? 64 : client->timer_room * 2;
+            client->timers = realloc(client->timers, sizeof(struct rdp_transfer*) * client->timer_room);
+        }
+        timer_place(client, client->timer_count, transfer);
+        client->timer_count++;
+    }
+    timer_up(client, transfer->timer);
+    timer_down(client, transfer->timer);
+}
+
+
+/*Function that removes a transfer from the client, calls its callback and frees it
+The file must already be closed, or never have been opened
+client: the client the transfer runs in
+transfer: the transfer that has ended
+status: the RDP_STATUS_ value given to the callback*/
+static void end_transfer(struct rdp_client* client, struct rdp_transfer* transfer, int status) {
+    struct rdp_transfer** link = &client->transfers[(unsigned int) transfer->id % RDP_BUCKETS];
+    while (*link != transfer) {
+        link = &(*link)->next;
+    }
+    *link = transfer->next;
+    client->count--;
+    stop_timer(client, transfer);
+
+    transfer->state = RDP_FAILED;
+    if (status == RDP_STATUS_OK) {
+        transfer->state = RDP_DONE;
+    }
+    fec_reset(&transfer->group, 0, 0);
+    if (transfer->done != NULL) {
+        transfer->done(transfer, status, transfer->data);
+    }
+    free(transfer->filename);
+    free(transfer);
+}
+
+
+/*Function that ends a transfer once the writer thread has written everything and closed the file
+If the file was never opened, the transfer ends at once
+If the writer has no free buffer for the close, the timer tries again later
+client: the client the transfer runs in
+transfer: the transfer to end
+status: the RDP_STATUS_ value the transfer ends with*/
+static void close_transfer(struct rdp_client* client, struct rdp_transfer* transfer, int status) {
+    if (transfer->state == RDP_RECEIVING) {
+        client->receiving--;
+    }
+    transfer->state = RDP_CLOSING;
+    transfer->status = status;
+    fec_reset(&transfer->group, 0, 0);
+
+    if (transfer->fd == -1) {
+        end_transfer(client, transfer, status);
+        return;
+    }
+    if (rdp_writer_close(&client->writer, transfer, transfer->fd) == 1) {
+        transfer->fd = -1;
+        set_timer(client, transfer, -1);
+    }
+    else {
+        set_timer(client, transfer, RDP_ACK_TIMEOUT);
+    }
+}
+
+
+/*Function that opens the file of a transfer when the server has accepted it
+If the file exists or can not be opened, send a termination packet,
+so that the server does not wait for a client that failed here
+Return RDP_STATUS_OK, or the status the transfer failed with
+client: the client the transfer runs in
+transfer: the transfer to open the file for*/
+static int open_file(struct rdp_client* client, struct rdp_transfer* transfer) {
+    transfer->fd = open(transfer->filename, O_WRONLY | O_CREAT | O_EXCL, 0644);
+    if (transfer->fd == -1 && errno == EEXIST) {
+        printf("ERROR: The file %s already exists\n", transfer->filename);
+        terminate_connection(client->socket, transfer->id, client->server);
+        return RDP_STATUS_FILE_EXISTS;
+    }
+    if (transfer->fd == -1) {
+        printf("ERROR: The file %s could not be opened\n", transfer->filename);
+        terminate_connection(client->socket, transfer->id, client->server);
+        return RDP_STATUS_FILE_ERROR;
+    }
+    return RDP_STATUS_OK;
+}
+
+
+struct rdp_client* rdp_client_create(const char* address, unsigned int port) {
+    struct rdp_client* client = calloc(1, sizeof(struct rdp_client));
+    if (client == NULL) {
+        return NULL;
+    }
+
+    /*Create socket for client*/
+    client->socket = socket(AF_INET, SOCK_DGRAM, 0);
+    if (client->socket == -1) {
+        free(client);
+        return NULL;
+    }
+
+    /*Create epoll instance, and let it watch the socket for packets*/
+    client->epoll = epoll_create1(0);
+    if (client->epoll == -1) {
+        close(client->socket);
+        free(client);
+        return NULL;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = client->socket;
+    if (epoll_ctl(client->epoll, EPOLL_CTL_ADD, client->socket, &event) == -1) {
+        close(client->epoll);
+        close(client->socket);
+        free(client);
+        return NULL;
+    }
+
+    /*Start the writer thread, and let epoll watch for writes it has finished.
+    If the writer can not start it has already freed what it made*/
+    if (rdp_writer_start(&client->writer) == -1) {
+        close(client->epoll);
+        close(client->socket);
+        free(client);
+        return NULL;
+    }
+    event.events = EPOLLIN;
+    event.data.fd = client->writer.done_fd;
+    if (epoll_ctl(client->epoll, EPOLL_CTL_ADD, client->writer.done_fd, &event) == -1) {
+        rdp_writer_stop(&client->writer);
+        close(client->epoll);
+        close(client->socket);
+        free(client);
+        return NULL;
+    }
+
+    /*Create sockaddr with information about the server*/
+    client->server.sin_family = AF_INET;
+    client->server.sin_port = htons(port);
+    client->server.sin_addr.s_addr = inet_addr(address);
+
+    /*Connect the socket to the server, so the kernel drops datagrams from anyone else
+    before they can reach a transfer*/
+    if (connect(client->socket, (struct sockaddr*)&client->server, sizeof(client->server)) == -1) {
+        rdp_writer_stop(&client->writer);
+        close(client->epoll);
+        close(client->socket);
+        free(client);
+        return NULL;
+    }
+
+    return client;
+}
+
+
+void rdp_client_destroy(struct rdp_client* client) {
+    /*Stop the writer first, so no file is closed while it still writes to it*/
+    rdp_writer_stop(&client->writer);
+    int i;
+    for (i = 0; i < RDP_BUCKETS; i++) {
+        while (client->transfers[i] != NULL) {
+            if (client->transfers[i]->fd != -1) {
+                close(client->transfers[i]->fd);
+            }
+            client->transfers[i]->done = NULL;
+            end_transfer(client, client->transfers[i], RDP_STATUS_TIMEOUT);
+        }
+    }
+    free(client->timers);
+    close(client->epoll);
+    close(client->socket);
+    free(client);
+}
+
+
+/*Function that sends a connect request with the last cookie from the server, and waits one second for the answer
+client: the client the transfer runs in
+transfer: the transfer to connect*/
+static void send_request(struct rdp_client* client, struct rdp_transfer* transfer) {
+    char* packet = (char *) createHeader(CONN_REQ, 0, 0, htonl(transfer->id), htonl(0), transfer->cookie);
+    int send = send_packet(client->socket, packet, sizeof(struct header), 0, (struct sockaddr*)&client->server, sizeof(client->server));
+    free(packet);
+    set_timer(client, transfer, RDP_CONNECT_TIMEOUT);
+}
+
+
+int rdp_client_free_id(struct rdp_client* client) {
+    /*Pick a free ID the same way the client always has*/
+    if (client->count >= 10000) {
+        return 0;
+    }
+    int id;
+    do {
+        id = rand() % 10000 + 1;
+    } while (find_transfer(client, id) != NULL);
+    return id;
+}
+
+
+struct rdp_transfer* rdp_transfer_create(struct rdp_client* client, int id, rdp_done_callback done, void* data) {
+    if (id <= 0 || find_transfer(client, id) != NULL) {
+        return NULL;
+    }
+
+    struct rdp_transfer* transfer = calloc(1, sizeof(struct rdp_transfer));
+    transfer->id = id;
+    transfer->state = RDP_CONNECTING;
+    transfer->filename = get_filename(id);
+    transfer->fd = -1;
+    transfer->timer = -1;
+    transfer->done = done;
+    transfer->data = data;
+    transfer->next = client->transfers[(unsigned int) id % RDP_BUCKETS];
+    client->transfers[(unsigned int) id % RDP_BUCKETS] = transfer;
+    client->count++;
+
+    send_request(client, transfer);
+    return transfer;
+}
+
+
+/*Function that handles the answer to a connect request
+The server answers the first request with a cookie, which is sent back in a new request
+If the server is busy it puts the request in a queue, until it sends an accept when a connection ends.
+A queued transfer asks again every RDP_QUEUED_TIMEOUT, and fails if RDP_CONNECT_TRIES requests in a row
+go unanswered, so it does not wait forever for a server that has gone away
+If the connection was accepted, open the file and start receiving packets
+client: the client the transfer runs in
+transfer: the transfer the answer is for
+header: the answer*/
+static void handle_connect_answer(struct rdp_client* client, struct rdp_transfer* transfer, struct header* header) {
+    if (header->flags == CONN_CHAL) {
+        /*The first request, or a request whose cookie has run out, is answered with a new cookie*/
+        transfer->cookie = header->metadata;
+        send_request(client, transfer);
+    }
+    else if (header->flags == CONN_QUEUED) {
+        if (transfer->state == RDP_CONNECTING) {
+            printf("Request queued by server, waiting for a free connection\n");
+        }
+        /*Ask again now and then, so the transfer fails if the server has gone away*/
+        transfer->state = RDP_QUEUED;
+        transfer->tries = 0;
+        set_timer(client, transfer, RDP_QUEUED_TIMEOUT);
+    }
+    else if (header->flags & PKT) {
+        /*Data sent after an accept packet that was lost, the server sends it again once we ack*/
+        return;
+    }
+    else if (header->flags == CONN_ACCP) {
+        int status = open_file(client, transfer);
+        if (status != RDP_STATUS_OK) {
+            end_transfer(client, transfer, status);
+            return;
+        }
+        transfer->state = RDP_RECEIVING;
+        client->receiving++;
+        set_timer(client, transfer, RDP_ACK_TIMEOUT);
+    }
+    else if (header->flags == CONN_DENY) {
+        printf("Received a reject packet. Terminating\n");
+        end_transfer(client, transfer, RDP_STATUS_DENIED);
+    }
+    else {
+        /*NOTE: this should never occur, but I added it for testing and as a formality*/
+        printf("ERROR: Received a flag this is not an accept or a refuse. Terminating. Flag: %d\n", header->flags);
+        end_transfer(client, transfer, RDP_STATUS_PROTOCOL);
+    }
+}
+
+
+/*Function that handles a packet for a transfer that is receiving the file
+packet: the packet, which is owned by this function
+len: the number of bytes in the packet
+The rest of the arguments are the same as handle_connect_answer*/
+static void handle_data(struct rdp_client* client, struct rdp_transfer* transfer, char* packet, int len) {
+    struct header* header = (struct header*) packet;
+    set_timer(client, transfer, RDP_ACK_TIMEOUT);
+
+    /*Send packet based on flag and size of payload*/
+    if (header->flags == PAR || (header->flags == PKT && header->metadata != 0 && header->unassigned != 0)) {
+
+        /*With FEC the server sends a group of packets followed by a parity packet*/
+        fec_add(&transfer->group, packet, len, transfer->ack);
+        fec_recover(&transfer->group);
+        transfer->ack = fec_write(&client->writer, transfer, transfer->ack);
+
+        /*Ack when the whole group is written, anything else waits for the timeout*/
+        if (transfer->group.end != 0 && transfer->ack == transfer->group.end) {
+            send_ack(client->socket, transfer->id, client->server, transfer->ack, transfer->group.recovered, receive_window(client));
+            printf("Sending ack-packet: %d\n", transfer->ack);
+            fec_reset(&transfer->group, 0, 0);
+        }
+
+    }
+    else if (header->flags == PKT && header->metadata != 0) {
+
+        /*A payload size that does not fit is dropped like a lost packet, and is sent again after the next ack*/
+        if (payload_fits(header, len) == 0) {
+            free(packet);
+            return;
+        }
+
+        send_ack(client->socket, transfer->id, client->server, transfer->ack, 0, receive_window(client));
+        printf("Sending ack-packet: %d\n", transfer->ack);
+
+        /*If the payload was handed to the writer, increase ack by one*/
+        transfer->ack += rdp_write(&client->writer, transfer, packet, transfer->ack);
+
+        free(packet);
+
+    }
+    else if (header->flags == PKT && header->metadata == 0) {
+        printf("Sending termination\n");
+        terminate_connection(client->socket, transfer->id, client->server);
+        free(packet);
+        close_transfer(client, transfer, RDP_STATUS_OK);
+    }
+    else {
+        printf("ERROR: Why did the client receive a packet that is not a data packet here?\n");
+        terminate_connection(client->socket, transfer->id, client->server);
+        free(packet);
+        close_transfer(client, transfer, RDP_STATUS_PROTOCOL);
+    }
+}
+
+
+void rdp_client_feed(struct rdp_client* client, const char* datagram, int len) {
+    if (len < (int) sizeof(struct header) || len > (int) PACKET_MAX_SIZE) {
+        return;
+    }
+    struct header* header = (struct header*) datagram;
+    struct rdp_transfer* transfer = find_transfer(client, ntohl(header->recvid));
+    if (transfer == NULL) {
+        return;
+    }
+
+    if (transfer->state == RDP_CONNECTING || transfer->state == RDP_QUEUED) {
+        struct header answer;
+        memcpy(&answer, datagram, sizeof(struct header));
+        handle_connect_answer(client, transfer, &answer);
+    }
+    else if (transfer->state == RDP_RECEIVING) {
+        /*Answers to a connect request that was sent again can arrive after the transfer was accepted*/
+        if (header->flags == CONN_ACCP || header->flags == CONN_QUEUED || header->flags == CONN_CHAL) {
+            return;
+        }
+        /*Save packet to a char array with the greatest size the packet can have,
+        and clear the space after the payload so a parity packet can be used to rebuild a packet*/
+        char* packet = calloc(1, PACKET_MAX_SIZE);
+        memcpy(packet, datagram, len);
+        handle_data(client, transfer, packet, len);
+    }
+}
+
+
+int rdp_client_poll_timers(struct rdp_client* client) {
+    if (client->count == 0) {
+        return -1;
+    }
+    long now = now_ms();
+
+    /*Run the timers that have run out. They are at the top of the heap,
+    and every one that is run is stopped or set to run out later, so the loop ends*/
+    while (client->timer_count > 0 && client->timers[0]->deadline <= now) {
+        struct rdp_transfer* transfer = client->timers[0];
+        stop_timer(client, transfer);
+
+        if (transfer->state == RDP_CONNECTING || transfer->state == RDP_QUEUED) {
+            /*The request or its answer may have been lost, so send it again a few times before giving up*/
+            if (transfer->tries < RDP_CONNECT_TRIES) {
+                transfer->tries++;
+                send_request(client, transfer);
+                continue;
+            }
+            printf("ERROR: Did not receive a response to request within the time limit. Terminating.\n");
+            end_transfer(client, transfer, RDP_STATUS_TIMEOUT);
+            continue;
+        }
+        if (transfer->state == RDP_CLOSING) {
+            close_transfer(client, transfer, transfer->status);
+            continue;
+        }
+        /*Packets that waited for a free pool buffer can be written now*/
+        transfer->ack = fec_write(&client->writer, transfer, transfer->ack);
+        send_ack(client->socket, transfer->id, client->server, transfer->ack, transfer->group.recovered, receive_window(client));
+        printf("Sending ack-packet again\n");
+        set_timer(client, transfer, RDP_ACK_TIMEOUT);
+    }
+
+    if (client->count == 0) {
+        return -1;
+    }
+    if (client->timer_count == 0) {
+        return 1000;
+    }
+    return client->timers[0]->deadline - now;
+}
+
+
+void rdp_client_writes_done(struct rdp_client* client) {
+    uint64_t signals;
+    ssize_t r = read(client->writer.done_fd, &signals, sizeof(uint64_t));
+
+    struct rdp_write entry;
+    while (rdp_writer_done(&client->writer, &entry)) {
+        struct rdp_transfer* transfer = entry.transfer;
+        if (entry.error) {
+            transfer->write_error = 1;
+        }
+        if (entry.close) {
+            int status = transfer->status;
+            if (transfer->write_error && status == RDP_STATUS_OK) {
+                printf("ERROR: The file %s could not be written\n", transfer->filename);
+                status = RDP_STATUS_FILE_ERROR;
+            }
+            else if (status == RDP_STATUS_OK) {
+                printf("\nFILE %s: download complete\n\n", transfer->filename);
+            }
+            end_transfer(client, transfer, status);
+        }
+    }
+}
+
+
+void rdp_client_run(struct rdp_client* client) {
+    char datagram[PACKET_MAX_SIZE];
+    struct epoll_event events[2];
+    while (1) {
+        int timeout = rdp_client_poll_timers(client);
+        rdp_writer_flush(&client->writer);
+        if (timeout == -1) {
+            break;
+        }
+
+        /*Wait until a packet arrives, the writer finishes writes or the next timer runs out,
+        and read every packet that has arrived*/
+        int ready = epoll_wait(client->epoll, events, 2, timeout);
+        int i;
+        for (i = 0; i < ready; i++) {
+            if (events[i].data.fd == client->writer.done_fd) {
+                rdp_client_writes_done(client);
+                continue;
+            }
+            while (1) {
+                int len = recvfrom(client->socket, datagram, PACKET_MAX_SIZE, MSG_DONTWAIT, NULL, NULL);
+                if (len < 0) {
+                    break;
+                }
+                rdp_client_feed(client, datagram, len);
+            }
+        }
+        rdp_writer_flush(&client->writer);
+    }
+}
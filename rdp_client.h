@@ -0,0 +1,172 @@
+#ifndef RDP_CLIENT_H
+#define RDP_CLIENT_H
+
+#include <sys/epoll.h>
+
+#include "send_packet.h"
+#include "header.h"
+#include "fec.h"
+#include "rdp_writer.h"
+
+/* The states a transfer moves through. A transfer starts in RDP_CONNECTING,
+ * may wait in RDP_QUEUED if the server is busy, receives the file in
+ * RDP_RECEIVING, waits in RDP_CLOSING for the writer thread to write and close
+ * the file, and ends in RDP_DONE or RDP_FAILED.
+ */
+#define RDP_CONNECTING 0
+#define RDP_QUEUED 1
+#define RDP_RECEIVING 2
+#define RDP_CLOSING 3
+#define RDP_DONE 4
+#define RDP_FAILED 5
+
+/* The status a transfer ends with, which is given to the done callback.
+ */
+#define RDP_STATUS_OK 0
+#define RDP_STATUS_DENIED 1
+#define RDP_STATUS_TIMEOUT 2
+#define RDP_STATUS_FILE_EXISTS 3
+#define RDP_STATUS_FILE_ERROR 4
+#define RDP_STATUS_PROTOCOL 5
+
+/* How long a transfer waits for an answer to its connect request, how long it
+ * waits in the server's queue before it asks again, and how long it waits for a
+ * data packet before it sends its ack again, in milliseconds.
+ */
+#define RDP_CONNECT_TIMEOUT 1000
+#define RDP_QUEUED_TIMEOUT 5000
+#define RDP_ACK_TIMEOUT 100
+
+/* How many times a connect request is sent again without an answer before the
+ * transfer fails.
+ */
+#define RDP_CONNECT_TRIES 5
+
+/* Transfers are found from the recvid of a packet through a hash table with
+ * this many buckets.
+ */
+#define RDP_BUCKETS 1024
+
+struct rdp_transfer;
+
+/* Called once when a transfer is done or has failed. The transfer is freed
+ * right after the callback returns.
+ */
+typedef void (*rdp_done_callback)( struct rdp_transfer* transfer, int status, void* data );
+
+/* The FEC group a transfer is receiving
+ * start and end: the first and last packet of the group, 0 if there is no group
+ * packets: the packets in the group that have arrived or been rebuilt, NULL if missing
+ * parity: the parity packet of the group, NULL if it has not arrived
+ * recovered: the number of packets that were rebuilt from the parity packet
+ */
+struct fec_group {
+    int start;
+    int end;
+    char* packets[FEC_K_MAX];
+    char* parity;
+    int recovered;
+};
+
+/* One download, with the state that used to live on the stack of the client
+ * id: the senderid of the transfer, which the server puts in recvid
+ * state: one of the RDP_ states
+ * filename and fd: the file the payload is written to, fd is -1 when it is not open
+ *   or its close has been handed to the writer thread
+ * ack: the number of packets handed to the writer thread
+ * status: the status the transfer ends with once the file is closed
+ * cookie: the last cookie the server sent, which every connect request echoes
+ * tries: connect requests sent again since the server last answered
+ * write_error: set if the writer thread could not write a payload
+ * group: the FEC group that is being received
+ * deadline: when the timer of the transfer runs out, in milliseconds
+ * timer: where the transfer is in the timer heap of the client, -1 if its timer is stopped
+ * done and data: the callback to call when the transfer ends, and its argument
+ * next: the next transfer in the same hash bucket
+ */
+struct rdp_transfer {
+    int id;
+    int state;
+    char* filename;
+    int fd;
+    int ack;
+    int status;
+    int cookie;
+    int tries;
+    int write_error;
+    struct fec_group group;
+    long deadline;
+    int timer;
+    rdp_done_callback done;
+    void* data;
+    struct rdp_transfer* next;
+};
+
+/* The state shared by all transfers: one socket, one epoll instance, one
+ * writer thread, and the transfers that are running
+ * socket: the UDP socket all transfers send and receive on
+ * epoll: the epoll instance the socket and the writer thread are registered in
+ * server: the address of the server
+ * writer: the thread that writes payloads to file, so a slow disk does not hold up acks
+ * transfers: hash table of the running transfers, by id
+ * count: the number of running transfers
+ * receiving: the number of transfers in RDP_RECEIVING, which share the free pool buffers
+ * timers: min-heap of the transfers whose timer runs, by deadline, so only the timers
+ *   that have run out are looked at
+ * timer_count and timer_room: the number of transfers in the heap, and how many it has room for
+ */
+struct rdp_client {
+    int socket;
+    int epoll;
+    struct sockaddr_in server;
+    struct rdp_writer writer;
+    struct rdp_transfer* transfers[RDP_BUCKETS];
+    int count;
+    int receiving;
+    struct rdp_transfer** timers;
+    int timer_count;
+    int timer_room;
+};
+
+/* Creates the socket, epoll instance and writer thread for a client that
+ * downloads from the server at address and port. Returns NULL if any of them
+ * could not be created.
+ */
+struct rdp_client* rdp_client_create( const char* address, unsigned int port );
+
+/* Stops the writer thread, closes the socket and epoll instance, and frees the
+ * client. Transfers that are still running are freed without calling their
+ * callback.
+ */
+void rdp_client_destroy( struct rdp_client* client );
+
+/* Returns an id between 1 and 10000 that no running transfer has, or 0 if all
+ * of them are taken.
+ */
+int rdp_client_free_id( struct rdp_client* client );
+
+/* Starts a download with the given id to the file kernel-file-<id>, and sends
+ * the connect request. Returns NULL if the id is not above 0 or is taken.
+ */
+struct rdp_transfer* rdp_transfer_create( struct rdp_client* client, int id, rdp_done_callback done, void* data );
+
+/* Hands a datagram that was received on the socket to the transfer it is for.
+ * Datagrams for unknown transfers are ignored.
+ */
+void rdp_client_feed( struct rdp_client* client, const char* datagram, int len );
+
+/* Runs the timers of the transfers that have run out. Returns the number of
+ * milliseconds until the next timer runs out, or -1 if there are no transfers.
+ */
+int rdp_client_poll_timers( struct rdp_client* client );
+
+/* Handles the writes the writer thread has finished, and ends the transfers
+ * whose files it has closed. Call it when the writer's done_fd is readable.
+ */
+void rdp_client_writes_done( struct rdp_client* client );
+
+/* Runs the epoll loop until every transfer has ended.
+ */
+void rdp_client_run( struct rdp_client* client );
+
+#endif /* RDP_CLIENT_H */
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#include "rdp_writer.h"
+
+
+/*Function that adds an entry to a ring, only called from the thread that produces for the ring
+Return 0 if the ring is full
+ring: the ring to add to
+entry: the entry to copy into the ring*/
+static int ring_push(struct rdp_ring* ring, struct rdp_write* entry) {
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head == RDP_POOL_SIZE) {
+        return 0;
+    }
+    ring->entries[tail % RDP_POOL_SIZE] = *entry;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+
+/*Function that takes the oldest entry from a ring, only called from the thread that consumes the ring
+Return 0 if the ring is empty
+ring: the ring to take from
+entry: where to copy the entry*/
+static int ring_pop(struct rdp_ring* ring, struct rdp_write* entry) {
+    unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+    *entry = ring->entries[head % RDP_POOL_SIZE];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return 1;
+}
+
+
+/*Help method that wakes the thread waiting on an eventfd*/
+static void signal_fd(int fd) {
+    uint64_t one = 1;
+    ssize_t w = write(fd, &one, sizeof(uint64_t));
+}
+
+
+/*Function that writes a run of payloads that go one after another in the same file with one pwritev call,
+and writes the rest if pwritev only wrote some of it
+Return 0 if the write failed
+writer: the writer the payloads are in
+batch: the entries of the run
+count: the number of entries in the run*/
+static int write_run(struct rdp_writer* writer, struct rdp_write* batch, int count) {
+    struct iovec iov[RDP_BATCH];
+    int i;
+    for (i = 0; i < count; i++) {
+        iov[i].iov_base = writer->pool + (size_t) batch[i].slot * PAYLOAD_MAX_SIZE;
+        iov[i].iov_len = batch[i].len;
+    }
+
+    struct iovec* next = iov;
+    int left = count;
+    off_t offset = batch[0].offset;
+    while (left > 0) {
+        ssize_t written = pwritev(batch[0].fd, next, left, offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        offset += written;
+        /*Skip the buffers that were written, and move into the one that was written in part*/
+        while (left > 0 && (size_t) written >= next->iov_len) {
+            written -= next->iov_len;
+            next++;
+            left--;
+        }
+        if (left > 0) {
+            next->iov_base = (char*) next->iov_base + written;
+            next->iov_len -= written;
+        }
+    }
+    return 1;
+}
+
+
+/*The writer thread. It takes up to RDP_BATCH writes from the ring at a time,
+joins payloads that go one after another in the same file into one pwritev call,
+closes files when it reaches their close entry, and hands everything back to the network thread
+arg: the writer*/
+static void* writer_thread(void* arg) {
+    struct rdp_writer* writer = (struct rdp_writer*) arg;
+    struct rdp_write batch[RDP_BATCH];
+    uint64_t signals;
+
+    while (1) {
+        int count = 0;
+        while (count < RDP_BATCH && ring_pop(&writer->to_writer, &batch[count])) {
+            count++;
+        }
+
+        if (count == 0) {
+            if (atomic_load(&writer->stop)) {
+                break;
+            }
+            /*Sleep until the network thread adds writes. It signals after it has added them,
+            so writes added after the ring was found empty are never missed*/
+            ssize_t r = read(writer->wake_fd, &signals, sizeof(uint64_t));
+            continue;
+        }
+
+        int start = 0;
+        int i;
+        for (i = 0; i < count; i++) {
+            if (batch[i].close) {
+                close(batch[i].fd);
+                start = i + 1;
+                continue;
+            }
+            int last = (i + 1 == count || batch[i + 1].close || batch[i + 1].fd != batch[i].fd
+                || batch[i + 1].offset != batch[i].offset + batch[i].len);
+            if (last) {
+                if (write_run(writer, batch + start, i + 1 - start) == 0) {
+                    int j;
+                    for (j = start; j <= i; j++) {
+                        batch[j].error = 1;
+                    }
+                }
+                start = i + 1;
+            }
+        }
+
+        for (i = 0; i < count; i++) {
+            ring_push(&writer->from_writer, &batch[i]);
+        }
+        signal_fd(writer->done_fd);
+    }
+    return NULL;
+}
+
+
+int rdp_writer_start(struct rdp_writer* writer) {
+    writer->pool = malloc((size_t) RDP_POOL_SIZE * PAYLOAD_MAX_SIZE);
+    int i;
+    for (i = 0; i < RDP_POOL_SIZE; i++) {
+        writer->free_slots[i] = i;
+    }
+    writer->free_count = RDP_POOL_SIZE;
+    writer->unsignalled = 0;
+    atomic_init(&writer->to_writer.head, 0);
+    atomic_init(&writer->to_writer.tail, 0);
+    atomic_init(&writer->from_writer.head, 0);
+    atomic_init(&writer->from_writer.tail, 0);
+    atomic_init(&writer->stop, 0);
+
+    writer->wake_fd = eventfd(0, 0);
+    writer->done_fd = eventfd(0, EFD_NONBLOCK);
+    if (writer->pool == NULL || writer->wake_fd == -1 || writer->done_fd == -1
+        || pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+        /*Give back whatever was made before the step that failed*/
+        if (writer->wake_fd != -1) {
+            close(writer->wake_fd);
+        }
+        if (writer->done_fd != -1) {
+            close(writer->done_fd);
+        }
+        free(writer->pool);
+        writer->pool = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+void rdp_writer_stop(struct rdp_writer* writer) {
+    atomic_store(&writer->stop, 1);
+    signal_fd(writer->wake_fd);
+    pthread_join(writer->thread, NULL);
+    close(writer->wake_fd);
+    close(writer->done_fd);
+    free(writer->pool);
+}
+
+
+int rdp_writer_write(struct rdp_writer* writer, struct rdp_transfer* transfer, int fd, off_t offset, const char* payload, int len) {
+    if (writer->free_count == 0) {
+        return 0;
+    }
+    struct rdp_write entry;
+    memset(&entry, 0, sizeof(struct rdp_write));
+    entry.transfer = transfer;
+    entry.fd = fd;
+    entry.offset = offset;
+    entry.len = len;
+    entry.slot = writer->free_slots[--writer->free_count];
+    memcpy(writer->pool + (size_t) entry.slot * PAYLOAD_MAX_SIZE, payload, len);
+
+    ring_push(&writer->to_writer, &entry);
+    writer->unsignalled++;
+    return 1;
+}
+
+
+int rdp_writer_close(struct rdp_writer* writer, struct rdp_transfer* transfer, int fd) {
+    if (writer->free_count == 0) {
+        return 0;
+    }
+    struct rdp_write entry;
+    memset(&entry, 0, sizeof(struct rdp_write));
+    entry.transfer = transfer;
+    entry.fd = fd;
+    entry.close = 1;
+    entry.slot = writer->free_slots[--writer->free_count];
+
+    ring_push(&writer->to_writer, &entry);
+    writer->unsignalled++;
+    return 1;
+}
+
+
+void rdp_writer_flush(struct rdp_writer* writer) {
+    if (writer->unsignalled > 0) {
+        signal_fd(writer->wake_fd);
+        writer->unsignalled = 0;
+    }
+}
+
+
+int rdp_writer_done(struct rdp_writer* writer, struct rdp_write* entry) {
+    while (ring_pop(&writer->from_writer, entry)) {
+        writer->free_slots[writer->free_count++] = entry->slot;
+        if (entry->close || entry->error) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,110 @@
+#ifndef RDP_WRITER_H
+#define RDP_WRITER_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "header.h"
+
+/* The number of payload buffers shared by all transfers of a client. A buffer
+ * is taken when a payload is handed to the writer thread, and given back when
+ * it has been written. When none are free the client stops accepting packets,
+ * and advertises a smaller window to the server.
+ */
+#define RDP_POOL_SIZE 1024
+
+/* The most writes the writer thread takes from the ring at once, and so the
+ * most buffers that go into one pwritev call.
+ */
+#define RDP_BATCH 64
+
+struct rdp_transfer;
+
+/* One entry in a ring
+ * transfer: the transfer the write is for
+ * fd: the file to write to
+ * offset: where in the file the payload goes
+ * len: the size of the payload
+ * slot: the pool buffer that holds the payload
+ * close: 1 if the entry closes the file instead of writing to it
+ * error: set by the writer thread if the write failed
+ */
+struct rdp_write {
+    struct rdp_transfer* transfer;
+    int fd;
+    off_t offset;
+    int len;
+    int slot;
+    int close;
+    int error;
+};
+
+/* A lock-free ring with a single producer and a single consumer. Every entry
+ * holds a pool buffer, so a ring with RDP_POOL_SIZE entries can never be full.
+ * head and tail are on their own cache lines so the two threads do not fight
+ * over them.
+ */
+struct rdp_ring {
+    struct rdp_write entries[RDP_POOL_SIZE];
+    _Alignas(64) atomic_uint head;
+    _Alignas(64) atomic_uint tail;
+};
+
+/* The writer thread and what it shares with the network thread
+ * pool: the payload buffers, RDP_POOL_SIZE of PAYLOAD_MAX_SIZE bytes
+ * free_slots and free_count: the pool buffers that are free, only used by the network thread
+ * unsignalled: writes added since the writer thread was last woken
+ * to_writer: writes from the network thread to the writer thread
+ * from_writer: finished writes from the writer thread back to the network thread
+ * wake_fd: eventfd the network thread signals when it has added writes
+ * done_fd: eventfd the writer thread signals when it has finished writes
+ * stop: set to make the writer thread finish the writes it has and end
+ */
+struct rdp_writer {
+    char* pool;
+    int free_slots[RDP_POOL_SIZE];
+    int free_count;
+    int unsignalled;
+    struct rdp_ring to_writer;
+    struct rdp_ring from_writer;
+    int wake_fd;
+    int done_fd;
+    atomic_int stop;
+    pthread_t thread;
+};
+
+/* Allocates the pool and starts the writer thread. Returns -1 if it could not
+ * be started, in which case everything it made is freed again and
+ * rdp_writer_stop must not be called.
+ */
+int rdp_writer_start( struct rdp_writer* writer );
+
+/* Lets the writer thread finish the writes it has, waits for it to end, and
+ * frees the pool.
+ */
+void rdp_writer_stop( struct rdp_writer* writer );
+
+/* Copies a payload into a pool buffer and hands it to the writer thread. The
+ * writer thread is not woken until rdp_writer_flush is called. Returns 0 if
+ * there is no free buffer, and nothing was written.
+ */
+int rdp_writer_write( struct rdp_writer* writer, struct rdp_transfer* transfer, int fd, off_t offset, const char* payload, int len );
+
+/* Hands the writer thread an entry that closes the file once every write
+ * before it is done. Returns 0 if there is no free buffer for the entry.
+ */
+int rdp_writer_close( struct rdp_writer* writer, struct rdp_transfer* transfer, int fd );
+
+/* Wakes the writer thread if writes have been added since it was last woken.
+ * The network thread calls this once per round of packets, not once per write.
+ */
+void rdp_writer_flush( struct rdp_writer* writer );
+
+/* Gives the buffers of finished writes back to the pool. Returns 1 and fills
+ * in entry when it finds a close entry or a write that failed, which the
+ * network thread must handle, and 0 when there are no more finished writes.
+ */
+int rdp_writer_done( struct rdp_writer* writer, struct rdp_write* entry );
+
+#endif /* RDP_WRITER_H */
@@ -16,16 +16,51 @@
 
 #include "send_packet.h"
 #include "header.h"
+#include "fec.h"
+#include "cookie.h"
+
+
+/*Limits for the scheduler and the admission queue
+ACTIVE_MAX: how many connections are served at the same time
+QUANTUM: bytes of credit a connection gets each scheduling round
+SEND_RATE: bytes per second the server may send, shared by all connections
+SEND_BURST: the most bytes of unused send budget the server can save up*/
+#define ACTIVE_MAX 8
+#define QUANTUM (PACKET_MAX_SIZE)
+#define SEND_RATE (4096 * (PACKET_MAX_SIZE))
+#define SEND_BURST (64 * (PACKET_MAX_SIZE))
+
+/*FEC_GROW_AFTER: how many groups in a row must arrive without loss before the FEC group grows*/
+#define FEC_GROW_AFTER 4
+
+/*Values for the active field of a connection*/
+#define CONNECT_ACTIVE 1
+#define CONNECT_QUEUED 2
 
 
 /*Global variables
 n: the total number of files to be served
-size and packets_num: number of elements in arrays
+served: the number of files that have been served
+size, queue_len and packets_num: number of elements in arrays
 connections: connections to clients
+queue: connect requests waiting for a free connection
+queue_max: how many connect requests can wait, enough for every file that is not served at once
+next_conn: the connection the next scheduling round starts at
+budget: bytes the server may send before it must wait for the budget to refill
+last_refill: when the budget was last refilled
+fec_k_start: the FEC group size new connections start at, 0 if FEC is off
 packets: packets with data from file*/
 int n;
+int served;
 int size;
 struct rdp_connection** connections;
+int queue_len;
+struct rdp_connection** queue;
+int queue_max;
+int next_conn;
+long budget;
+struct timeval last_refill;
+int fec_k_start;
 int packets_num;
 char** packets;
 
@@ -33,12 +68,26 @@ char** packets;
 /*Struct for a connection
 client: address for client
 senderid: client id (unique)
-active: if the connection has ended or not*/
+active: if the connection is served or waiting in the queue
+expected_ack: the ack the connection is expecting
+pending_ack: the ack the next packet is sent for, -1 if nothing is to be sent
+deficit: bytes the connection may send before the scheduler moves on
+group_start and group_end: the first and last packet of the FEC group that was sent last
+fec_k: the number of packets in the next FEC group
+clean_groups: FEC groups in a row that arrived without any loss
+window: the number of packets the client said it has room for in its last ack*/
 struct rdp_connection {
     struct sockaddr_in client;
     int id;
     unsigned char active;
     int expected_ack;
+    int pending_ack;
+    int deficit;
+    int group_start;
+    int group_end;
+    int fec_k;
+    int clean_groups;
+    int window;
 };
 
 
@@ -83,78 +132,148 @@ void create_payloadpacket(FILE* file, int last_pkt_size) {
 }
 
 
-/*Function that checks if the packet is a connect request,
-and determines wether to add or refuse the connect request
-If the new connection has the same ID as an active connection, or size is n,
-add a marker that says it is to be rejected
-else increase the size of the connections array to fit it, copy all the other connections over and add it
-Return the connection object if it was a request, NULL if it was not
-packet: the packet that was sent and contains the flags
-client: the client socket that we want to save and/or return*/
+/*Function that sends a control packet from a header on the stack,
+so that answering a connect request never allocates memory
+socket: the socket of the server
+flag: the flag of the packet
+senderid: the ID of the client, set as recvid
+client: the address of the client
+metadata: the metadata of the packet*/
+void send_control(int socket, unsigned char flag, int senderid, struct sockaddr_in client, int metadata) {
+    struct header packet;
+    memset(&packet, 0, sizeof(struct header));
+    packet.flags = flag;
+    packet.senderid = htonl(0);
+    packet.recvid = htonl(senderid);
+    packet.metadata = metadata;
+    int send = send_packet(socket, (char*) &packet, sizeof(struct header), 0, (struct sockaddr*)&client, sizeof(struct sockaddr_in));
+}
+
+
+/*Function that checks the cookie of a connect request
+The first request from a client has no cookie, and is answered with a cookie made from its address and ID.
+Nothing is saved about the client, so a flood of requests costs a hash and a packet each, and no memory.
+Only when the client sends the request again with the cookie, does the server save the connection
+Return 1 if the request has a valid cookie, 0 if a cookie was sent instead
+socket: the socket of the server
+packet: the connect request
+client: the address of the client*/
+int check_cookie(int socket, struct header packet, struct sockaddr_in client) {
+    int senderid = ntohl(packet.senderid);
+    if (cookie_check(client, senderid, (uint32_t) packet.metadata) == 1) {
+        return 1;
+    }
+    send_control(socket, CONN_CHAL, senderid, client, (int) cookie_make(client, senderid));
+    return 0;
+}
+
+
+/*Function that determines wether to add, queue or refuse a connect request
+If the new connection has the same ID as a served or queued connection,
+or all the files left to serve are taken, it is refused before any memory is allocated.
+The queue has room for every file that can not be served at once, so a request is never
+refused for lack of room while the server still has files it is waiting to serve
+If there are less than ACTIVE_MAX connections, increase the size of the connections array to fit it,
+copy all the other connections over and add it
+else add it to the back of the queue, where it waits for a connection to terminate
+Return the connection object, or NULL if it was refused
+packet: the connect request
+client: the client socket that we want to save*/
 struct rdp_connection* rdp_accept(struct header packet, struct sockaddr_in client) {
-    if (packet.flags == CONN_REQ) {
-        struct rdp_connection* new_connect = malloc(sizeof(struct rdp_connection));
-        new_connect->client = client;
-        new_connect->id = ntohl(packet.senderid);
-        new_connect->active = 0;
-        new_connect->expected_ack = 0;
-        //If the server is not serving the final file at the moment
-        if (size < n) {
-            /*Check if the ID is already connected,
-            if not, resize the connections array to fit the new connection*/
-            int num_already_there = 0;
-            int i;
-            for (i = 0; i < size; i++) {
-                if (connections[i]->id == new_connect->id) {
-                    num_already_there = 1;
-                    break;
-                }
-            }
-            if (num_already_there == 0) {
-                new_connect->active = 1;
-                size++;
-                struct rdp_connection** new_connections = malloc(sizeof(struct rdp_connection*) * size);
-                memcpy(new_connections, connections, sizeof(struct rdp_connection*) * (size - 1));
-                free(connections);
-                connections = new_connections;
-                connections[size - 1] = new_connect;
-            }
+    int senderid = ntohl(packet.senderid);
+
+    /*Check if the ID is already connected or waiting*/
+    int i;
+    for (i = 0; i < size; i++) {
+        if (connections[i]->id == senderid) {
+            return NULL;
         }
-        return new_connect;
     }
-    return NULL;
+    for (i = 0; i < queue_len; i++) {
+        if (queue[i]->id == senderid) {
+            return NULL;
+        }
+    }
+
+    unsigned char active;
+    //If the server is not serving the final files at the moment
+    if (size < ACTIVE_MAX && served + size < n) {
+        active = CONNECT_ACTIVE;
+    }
+    else if (queue_len < queue_max && served + size + queue_len < n) {
+        active = CONNECT_QUEUED;
+    }
+    else {
+        return NULL;
+    }
+
+    struct rdp_connection* new_connect = malloc(sizeof(struct rdp_connection));
+    new_connect->client = client;
+    new_connect->id = senderid;
+    new_connect->active = active;
+    new_connect->expected_ack = 0;
+    new_connect->pending_ack = -1;
+    new_connect->deficit = 0;
+    new_connect->group_start = 0;
+    new_connect->group_end = 0;
+    new_connect->fec_k = fec_k_start;
+    new_connect->clean_groups = 0;
+    new_connect->window = FEC_K_MAX; //until the first ack says how much room the client has
+
+    if (active == CONNECT_ACTIVE) {
+        size++;
+        struct rdp_connection** new_connections = malloc(sizeof(struct rdp_connection*) * size);
+        memcpy(new_connections, connections, sizeof(struct rdp_connection*) * (size - 1));
+        free(connections);
+        connections = new_connections;
+        connections[size - 1] = new_connect;
+    }
+    else {
+        queue[queue_len] = new_connect;
+        queue_len++;
+    }
+    return new_connect;
+}
+
+
+/*Function that sends a refuse packet
+socket: the socket of the server
+senderid: the ID of the client that was refused
+client: the address of the client*/
+void reject(int socket, int senderid, struct sockaddr_in client) {
+    send_control(socket, CONN_DENY, senderid, client, 0);
+    printf("\nNOT CONNECTED %i %i\n\n", senderid, 0);
 }
 
 
-/*Function that sends a packet connect or refuse packet
-If the connection is inactive due to n or the connection ID is taken, send a refuse packet
-Else send a confirm packet
+/*Function that sends a connect or queued packet
+If the connection is waiting in the queue, send a queued packet
+Else send a confirm packet, and let the scheduler send the first packet
 socket: the socket of the server
 connect: the connect object containing the socket of the client*/
-int confirm_or_reject(int socket, struct rdp_connection* connect) {
+int confirm_or_queue(int socket, struct rdp_connection* connect) {
     int confirmed = 1;
     unsigned char flag = CONN_ACCP;
     int senderid = connect->id;
-    struct sockaddr_in client = connect->client;
 
-    if (connect->active == 0) {
-        flag = CONN_DENY;
-        free(connect);
+    if (connect->active == CONNECT_QUEUED) {
+        flag = CONN_QUEUED;
         confirmed = 0;
     }
+    else {
+        connect->pending_ack = 0;
+    }
 
-    char* packet = (char *) createHeader(flag, 0, 0, htonl(0), htonl(senderid), 0);
-    int send = send_packet(socket, packet, sizeof(struct header), 0, (struct sockaddr*)&client, sizeof(struct sockaddr_in));
-    
-    if (flag == CONN_DENY) {
-        printf("\nNOT ");
+    send_control(socket, flag, senderid, connect->client, 0);
+
+    if (flag == CONN_QUEUED) {
+        printf("\nQUEUED, NOT YET ");
     }
     else {
         printf("\n");
     }
     printf("CONNECTED %i %i\n\n", senderid, 0);
-    
-    free(packet);
+
     return confirmed;
 }
 
@@ -184,27 +303,80 @@ void terminate_connection(int senderid) {
 }
 
 
+/*Function that moves the first connection in the queue over to the connections array
+when a connection has terminated, and sends it a confirm packet
+socket: the server socket*/
+void admit_queued(int socket) {
+    if (queue_len == 0 || size >= ACTIVE_MAX) {
+        return;
+    }
+    struct rdp_connection* connect = queue[0];
+    queue_len--;
+    memmove(queue, queue + 1, sizeof(struct rdp_connection*) * queue_len);
+
+    connect->active = CONNECT_ACTIVE;
+    size++;
+    struct rdp_connection** new_connections = malloc(sizeof(struct rdp_connection*) * size);
+    memcpy(new_connections, connections, sizeof(struct rdp_connection*) * (size - 1));
+    free(connections);
+    connections = new_connections;
+    connections[size - 1] = connect;
+
+    confirm_or_queue(socket, connect);
+}
+
+
+/*Function that finds a served connection from its ID, NULL if it is not served
+senderid: the ID of the connection*/
+struct rdp_connection* find_connection(int senderid) {
+    int i;
+    for (i = 0; i < size; i++) {
+        if (connections[i]->id == senderid) {
+            return connections[i];
+        }
+    }
+    return NULL;
+}
+
+
+/*Function that answers a connect request from a client that is already served or queued,
+which happens when the client did not get the answer and sent the request again.
+The answer is sent again without changing the connection
+Return 1 if the request was answered, 0 if no connection from that client has the ID
+socket: the server socket
+senderid: the ID in the request
+client: the address the request came from*/
+int answer_again(int socket, int senderid, struct sockaddr_in client) {
+    struct rdp_connection* connect = find_connection(senderid);
+    int i;
+    for (i = 0; connect == NULL && i < queue_len; i++) {
+        if (queue[i]->id == senderid) {
+            connect = queue[i];
+        }
+    }
+    if (connect == NULL || connect->client.sin_addr.s_addr != client.sin_addr.s_addr
+        || connect->client.sin_port != client.sin_port) {
+        return 0;
+    }
+    send_control(socket, connect->active == CONNECT_QUEUED ? CONN_QUEUED : CONN_ACCP, senderid, client, 0);
+    return 1;
+}
+
+
 /*Function that sends the packet that is on the same index as the ack it received.
 If the ack is packets_num, it will send an empty packet
 socket: the server socket
-senderid: the id to attach to the header. Also used for finding the connection
+client: the connection to send to. Its ID is attached to the header
 ackseq: index of the packet to be sent. Used as pktseq
-last_pkt_size: only the last packet has a different size, so it needs to be handled separately*/
-void send_payloadpacket(int socket, int senderid, int ackseq, int last_pkt_size) {
-    struct rdp_connection* client;
+last_pkt_size: only the last packet has a different size, so it needs to be handled separately
+Return the number of bytes that were sent*/
+int send_payloadpacket(int socket, struct rdp_connection* client, int ackseq, int last_pkt_size) {
     struct sockaddr_in client_address;
     char* packet;
     struct header* header;
     int pkt_size;
     int packet_sequence;
-    /*Finds the socket of the client from connections*/
-    int i;
-    for (i = 0; i < size; i++) {
-        if (connections[i]->id == senderid) {
-            client = connections[i];
-            break;
-        }
-    }
+    int senderid = client->id;
     client_address = client->client;
 
     /*Each connection contains the ack it is expecting,
@@ -244,12 +416,293 @@ void send_payloadpacket(int socket, int senderid, int ackseq, int last_pkt_size)
     if (ackseq == packets_num) {
         free(packet);
     }
+    return pkt_size;
+}
+
+
+/*Function that returns the size of the packet send_payloadpacket will send for an ack,
+so the scheduler can charge it before it is sent
+ackseq: the ack the packet is sent for
+last_pkt_size: size of the payload of the last packet*/
+int payloadpacket_size(int ackseq, int last_pkt_size) {
+    if (ackseq == packets_num) {
+        return sizeof(struct header);
+    }
+    if (ackseq == (packets_num - 1)) {
+        return sizeof(struct header) + (sizeof(char) * last_pkt_size);
+    }
+    return PACKET_MAX_SIZE;
+}
+
+
+/*Function that returns the size of the payload of a packet
+seq: the sequence number of the packet, 1 -> packets_num
+last_pkt_size: size of the payload of the last packet*/
+int payload_size(int seq, int last_pkt_size) {
+    if (seq == packets_num) {
+        return last_pkt_size;
+    }
+    return PAYLOAD_MAX_SIZE;
+}
+
+
+/*Function that finds which packets to send for an ack when FEC is on
+If the ack covers the whole group that was sent last, the next group starts after the ack,
+and is no larger than the window of the client
+else the client is missing packets in the group, and the rest of the group is sent again
+Return 0 if the ack is older than the group, and nothing should be sent
+client: the connection the ack came from
+ackseq: the ack the packets are sent for
+first and last: set to the first and last packet to send*/
+int fec_group_bounds(struct rdp_connection* client, int ackseq, int* first, int* last) {
+    if (ackseq < client->group_start - 1) {
+        return 0;
+    }
+    *first = ackseq + 1;
+    if (ackseq >= client->group_end) {
+        *last = ackseq + client->fec_k;
+        if (client->window < client->fec_k) {
+            *last = ackseq + client->window;
+        }
+        if (*last > packets_num) {
+            *last = packets_num;
+        }
+    }
+    else {
+        *last = client->group_end;
+    }
+    return 1;
+}
+
+
+/*Function that returns how many bytes send_fecgroup will send for an ack,
+which is the data packets and the parity packet
+client: the connection to send to
+ackseq: the ack the packets are sent for
+last_pkt_size: size of the payload of the last packet*/
+int fecgroup_size(struct rdp_connection* client, int ackseq, int last_pkt_size) {
+    int first;
+    int last;
+    if (fec_group_bounds(client, ackseq, &first, &last) == 0) {
+        return 0;
+    }
+    int start = first;
+    if (ackseq < client->group_end) {
+        start = client->group_start;
+    }
+    /*Only the last packet can be smaller, so the parity is as large as the first packet in the group*/
+    int bytes = sizeof(struct header) + payload_size(start, last_pkt_size);
+    int seq;
+    for (seq = first; seq <= last; seq++) {
+        bytes += sizeof(struct header) + payload_size(seq, last_pkt_size);
+    }
+    return bytes;
+}
+
+
+/*Function that sends a group of packets followed by a parity packet,
+so the client can rebuild one lost packet in the group without waiting for it to be sent again
+Data packets carry the last packet of the group as ackseq and the size of the group as unassigned.
+The parity packet carries the first and last packet of the group as pktseq and ackseq,
+and the XOR of the payload sizes as metadata, so the size of a lost packet can be rebuilt too
+socket: the server socket
+client: the connection to send to
+ackseq: the ack the packets are sent for
+last_pkt_size: size of the payload of the last packet
+Return the number of bytes that were sent*/
+int send_fecgroup(int socket, struct rdp_connection* client, int ackseq, int last_pkt_size) {
+    int first;
+    int last;
+    if (fec_group_bounds(client, ackseq, &first, &last) == 0) {
+        return 0;
+    }
+    if (ackseq >= client->group_end) {
+        client->group_start = first;
+        client->group_end = last;
+    }
+    else {
+        printf("Resending packets %d to %d\n", first, last);
+    }
+
+    struct sockaddr_in client_address = client->client;
+    int group_len = client->group_end - client->group_start + 1;
+    int bytes = 0;
+    struct header* header;
+    int seq;
+    for (seq = first; seq <= last; seq++) {
+        char* packet = packets[seq - 1];
+        int len = payload_size(seq, last_pkt_size);
+        header = createHeader(PKT, seq, client->group_end, htonl(0), htonl(client->id), len);
+        header->unassigned = group_len;
+        memcpy(packet, header, sizeof(struct header));
+        free(header);
+
+        printf("Sending packet nr: %d\n", seq);
+        int send = send_packet(socket, packet, sizeof(struct header) + len, 0, (struct sockaddr*)&client_address, sizeof(struct sockaddr_in));
+        bytes += sizeof(struct header) + len;
+    }
+
+    /*The parity is made over the whole group, also when only the end of it is sent again*/
+    char* parity = calloc(1, PACKET_MAX_SIZE);
+    int parity_len = payload_size(client->group_start, last_pkt_size);
+    int len_xor = 0;
+    for (seq = client->group_start; seq <= client->group_end; seq++) {
+        int len = payload_size(seq, last_pkt_size);
+        fec_xor(parity + sizeof(struct header), packets[seq - 1] + sizeof(struct header), len);
+        len_xor ^= len;
+    }
+    header = createHeader(PAR, client->group_start, client->group_end, htonl(0), htonl(client->id), len_xor);
+    header->unassigned = group_len;
+    memcpy(parity, header, sizeof(struct header));
+    free(header);
+
+    printf("Sending parity for packets %d to %d\n", client->group_start, client->group_end);
+    int send = send_packet(socket, parity, sizeof(struct header) + parity_len, 0, (struct sockaddr*)&client_address, sizeof(struct sockaddr_in));
+    bytes += sizeof(struct header) + parity_len;
+    free(parity);
+
+    return bytes;
+}
+
+
+/*Function that changes the FEC group size from the loss the client sees
+If the ack covers the group, the group arrived. If no packets had to be rebuilt either,
+the group grows after FEC_GROW_AFTER such groups in a row, so there are fewer parity packets
+If the ack is inside the group, more than one packet was lost and the client had to wait,
+so the group is halved to send parity more often
+client: the connection the ack came from
+ackseq: the ack that was received
+recovered: the number of packets the client rebuilt in the group*/
+void fec_adapt(struct rdp_connection* client, int ackseq, int recovered) {
+    if (client->group_end == 0 || ackseq < client->group_start - 1) {
+        return;
+    }
+    if (ackseq >= client->group_end) {
+        if (recovered > 0) {
+            client->clean_groups = 0;
+            return;
+        }
+        client->clean_groups++;
+        if (client->clean_groups >= FEC_GROW_AFTER && client->fec_k < FEC_K_MAX) {
+            client->fec_k++;
+            client->clean_groups = 0;
+        }
+    }
+    else {
+        client->fec_k = client->fec_k / 2;
+        if (client->fec_k < FEC_K_MIN) {
+            client->fec_k = FEC_K_MIN;
+        }
+        client->clean_groups = 0;
+    }
+}
+
+
+/*Help methods so the scheduler does not need to know if FEC is on
+FEC is not used for the empty packet that ends the connection
+If the client has no room for packets, nothing is sent until an ack says it has room again*/
+int next_send_size(struct rdp_connection* client, int last_pkt_size) {
+    if (client->window <= 0 && client->pending_ack < packets_num) {
+        return 0;
+    }
+    if (client->fec_k > 0 && client->pending_ack < packets_num) {
+        return fecgroup_size(client, client->pending_ack, last_pkt_size);
+    }
+    return payloadpacket_size(client->pending_ack, last_pkt_size);
+}
+
+int send_next(int socket, struct rdp_connection* client, int last_pkt_size) {
+    if (client->window <= 0 && client->pending_ack < packets_num) {
+        printf("Client %d has no room, waiting for its next ack\n", client->id);
+        return 0;
+    }
+    if (client->fec_k > 0 && client->pending_ack < packets_num) {
+        return send_fecgroup(socket, client, client->pending_ack, last_pkt_size);
+    }
+    return send_payloadpacket(socket, client, client->pending_ack, last_pkt_size);
+}
+
+
+/*Function that adds the bytes the server may send for the time since the last refill,
+so the server sends at most SEND_RATE bytes per second however often it is called
+Budget that is not used is kept for later calls, up to SEND_BURST bytes*/
+void refill_budget() {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long long elapsed = (long long) (now.tv_sec - last_refill.tv_sec) * 1000000 + (now.tv_usec - last_refill.tv_usec);
+    long earned = elapsed * (long) SEND_RATE / 1000000;
+    /*Keep the time that has not earned a whole byte yet, so frequent calls do not lose it*/
+    if (earned <= 0) {
+        return;
+    }
+    budget += earned;
+    if (budget > (long) SEND_BURST) {
+        budget = SEND_BURST;
+    }
+    last_refill = now;
+}
+
+
+/*Function that returns the microseconds until the budget covers a full packet again*/
+long budget_wait() {
+    if (budget >= (long) QUANTUM) {
+        return 0;
+    }
+    return ((long) QUANTUM - budget) * 1000000 / (long) SEND_RATE + 1;
+}
+
+
+/*Function that decides which connections get to send, using deficit round robin
+Each round every connection with a pending packet gets QUANTUM bytes of credit,
+and sends when the credit covers the packet. Connections with nothing to send lose their credit,
+so a client that acks quickly can not save up credit and starve the others.
+Connections that are still waiting to send keep their credit until the next call.
+Sending stops when the budget runs out, and the next call starts at the next connection
+Return the number of connections that still have a pending packet
+socket: the server socket
+last_pkt_size: size of the payload of the last packet*/
+int schedule_sends(int socket, int last_pkt_size) {
+    refill_budget();
+    int pending = 1;
+    int i;
+    while (budget > 0 && pending > 0) {
+        pending = 0;
+        for (i = 0; i < size && budget > 0; i++) {
+            struct rdp_connection* client = connections[(next_conn + i) % size];
+            if (client->pending_ack < 0) {
+                client->deficit = 0;
+                continue;
+            }
+            client->deficit += QUANTUM;
+            int cost = next_send_size(client, last_pkt_size);
+            if (client->deficit >= cost) {
+                budget -= send_next(socket, client, last_pkt_size);
+                client->deficit -= cost;
+                client->pending_ack = -1;
+            }
+            else {
+                pending++;
+            }
+        }
+    }
+    if (size > 0) {
+        next_conn = (next_conn + 1) % size;
+    }
+
+    pending = 0;
+    for (i = 0; i < size; i++) {
+        if (connections[i]->pending_ack >= 0) {
+            pending++;
+        }
+    }
+    return pending;
 }
 
 
 int main(int argc, char* argv[]) {
     if(argc < 5) {
         printf("4 arguments needed: <UDP port> <filename> <N number of clients to serve> <loss probability>\n");
+        printf("optional 5th argument: <FEC group size, 0 to turn FEC off>\n");
         return 1;
     }
 
@@ -260,6 +713,10 @@ int main(int argc, char* argv[]) {
     n = atoi(argv[3]);
     float prob = atof(argv[4]);
     set_loss_probability(prob);
+    fec_k_start = 0;
+    if (argc > 5) {
+        fec_k_start = atoi(argv[5]);
+    }
 
     /*Test that all values that are to be in a certain range are so*/
     if (n < 1 || prob < 0 || prob > 1 || port == 0) {
@@ -268,6 +725,10 @@ int main(int argc, char* argv[]) {
         printf(" and the loss probability must be between 0 and 1\n");
         return 2;
     }
+    if (fec_k_start != 0 && (fec_k_start < FEC_K_MIN || fec_k_start > FEC_K_MAX)) {
+        printf("ERROR: The FEC group size must be 0, or between %d and %d\n", FEC_K_MIN, FEC_K_MAX);
+        return 2;
+    }
 
 
     /*Read file to memory as binary, so that we can partition its bytes into packets*/
@@ -279,10 +740,14 @@ int main(int argc, char* argv[]) {
 
 
     /*Set global variables*/
-    /*the max number of connections is the number of files to serve*/
-    /*Initially set to only fit one connection, will be expanded as more connections come in*/
+    /*At most ACTIVE_MAX connections are served at once, the rest of the files wait in the queue*/
+    /*Initially set to fit no connection, will be expanded as more connections come in*/
     size = 0;
     connections = malloc(sizeof(struct rdp_connection*) * size);
+    /*The queue holds the connections that do not fit in the ACTIVE_MAX served at once*/
+    queue_len = 0;
+    queue_max = n > ACTIVE_MAX ? n - ACTIVE_MAX : 0;
+    queue = malloc(sizeof(struct rdp_connection*) * queue_max);
     /*Find last packet size and assign space in array for all packets to be made*/
     int last_pkt_size = find_packet_num(file);
     int packet_size = (sizeof(struct header) + (sizeof(char)) * PAYLOAD_MAX_SIZE);
@@ -315,65 +780,110 @@ int main(int argc, char* argv[]) {
     }
 
 
+    /*Pick the key for the cookies that connect requests must echo*/
+    if (cookie_init() == -1) {
+        printf("ERROR: Could not pick a random key for connect cookies\n");
+        return 6;
+    }
+
+
     /*Create set of file descriptor and time structure*/
     fd_set set;
     struct timeval timeout;
     int stop;
 
 
-    int served = 0;
+    served = 0;
+    budget = SEND_BURST;
+    gettimeofday(&last_refill, NULL);
+    int pending = 0;
     while (1) {
 
         /*Reset file descriptors*/
         FD_ZERO(&set);
         FD_CLR(get_socket, &set);
         FD_SET(get_socket, &set);
-        /*Set timer to wait for 100 milliseconds*/
+        /*Set timer to wait for 1 second,
+        or until the budget has refilled if it ran out before every connection could send*/
         timeout.tv_sec = 1;
         timeout.tv_usec = 0;
+        if (pending > 0) {
+            long wait = budget_wait();
+            if (wait < 1000) {
+                wait = 1000;
+            }
+            timeout.tv_sec = wait / 1000000;
+            timeout.tv_usec = wait % 1000000;
+        }
 
 
         /*Wait for the set time, and check if something has arrived at the socket*/
         stop = select(FD_SETSIZE, &set, NULL, NULL, &timeout);
         if (FD_ISSET(get_socket, &set)) {
 
-            /*Store information about sender*/
-            struct sockaddr_in client_socket;
-            int len = sizeof(struct sockaddr_in);
-
-            struct header packet;
-            /*Receive connection request*/
-            int receive = recvfrom(get_socket, &packet, sizeof(struct header), 0, (struct sockaddr*)&client_socket, &len);
+            /*Read the packets that have arrived before sending anything,
+            so the scheduler and not the order of the acks decides who sends next.
+            A round reads at most two packets for every connection that can be served or is queued now,
+            so a flood of packets can not keep the scheduler from running*/
+            int drain_max = 2 * (ACTIVE_MAX + queue_len);
+            int drained;
+            for (drained = 0; drained < drain_max; drained++) {
+                /*Store information about sender*/
+                struct sockaddr_in client_socket;
+                int len = sizeof(struct sockaddr_in);
+
+                struct header packet;
+                /*Receive connection request*/
+                int receive = recvfrom(get_socket, &packet, sizeof(struct header), MSG_DONTWAIT, (struct sockaddr*)&client_socket, &len);
+                if (receive < 0) {
+                    break;
+                }
 
-            int pkt_senderid = ntohl(packet.senderid);
+                int pkt_senderid = ntohl(packet.senderid);
+
+                /*1. if connect request: Send a cookie if it has none, else send response to request,
+                and if accepted, the scheduler sends the first packet.
+                A request from a client that is already served or queued gets the same answer again*/
+                struct rdp_connection* connect;
+                if (packet.flags == CONN_REQ && check_cookie(get_socket, packet, client_socket) == 1
+                    && answer_again(get_socket, pkt_senderid, client_socket) == 0) {
+                    connect = rdp_accept(packet, client_socket);
+                    if (connect != NULL) {
+                        confirm_or_queue(get_socket, connect);
+                    }
+                    else {
+                        reject(get_socket, pkt_senderid, client_socket);
+                    }
+                }
 
-            /*1. if connect request: Send response to request, and id accept, send first packet*/
-            struct rdp_connection* connect = rdp_accept(packet, client_socket);
-            if (connect != NULL) {
-                int confirmed = confirm_or_reject(get_socket, connect);
-                if (confirmed == 1) {
-                    send_payloadpacket(get_socket, pkt_senderid, 0, last_pkt_size);
+                //2. if ack: Mark the next packet to the sender as pending
+                if (packet.flags == ACK) {
+                    printf("Received ack: %d from sender %d\n", packet.ackseq, pkt_senderid);
+                    connect = find_connection(pkt_senderid);
+                    if (connect != NULL) {
+                        if (connect->fec_k > 0) {
+                            fec_adapt(connect, packet.ackseq, packet.unassigned);
+                        }
+                        connect->window = packet.metadata;
+                        connect->pending_ack = packet.ackseq;
+                    }
                 }
-            }
 
-            //2. if ack: Send next packet to the sender
-            if (packet.flags == ACK) {
-                printf("Received ack: %d from sender %d\n", packet.ackseq, pkt_senderid);
-                send_payloadpacket(get_socket, pkt_senderid, packet.ackseq, last_pkt_size);
+                //3. if termination packet: Remove client from connections, and let the first in the queue in
+                if (packet.flags == CONN_TERM && find_connection(pkt_senderid) != NULL) {
+                    served++;
+                    terminate_connection(pkt_senderid);
+                    admit_queued(get_socket);
+                }
             }
+        }
 
-            //3. if termination packet: Remove client from connections
-            if (packet.flags == CONN_TERM) {
-                served++;
-                terminate_connection(pkt_senderid);
-            }
+        pending = schedule_sends(get_socket, last_pkt_size);
 
-            /*End loop when the number of files to be served and files served are the same*/
-            if (served == n) {
-                break;
-            }
+        /*End loop when the number of files to be served and files served are the same*/
+        if (served == n) {
+            break;
         }
-    
     }
 
 
@@ -383,6 +893,10 @@ int main(int argc, char* argv[]) {
         free(connections[i]);
     }
     free(connections);
+    for (i = 0; i < queue_len; i++) {
+        free(queue[i]);
+    }
+    free(queue);
     for (i = 0; i < packets_num; i++) {
         free(packets[i]);
     }